@@ -5,13 +5,131 @@
 #include <QStandardPaths>
 #include <QDebug>
 
+static const qint64 kPrefetchCacheBytes = 64 * 1024 * 1024;
+static const int kPrefetchDistance = 2;    // Скільки файлів попереду та позаду вибраного
+
+// PrefetchCache implementation
+PrefetchCache::PrefetchCache(qint64 maxBytes)
+    : m_bytes(0), m_maxBytes(maxBytes)
+{
+}
+
+std::shared_ptr<const ImageCompression::RawImageData> PrefetchCache::find(const QString& path) {
+    QMutexLocker locker(&m_mutex);
+
+    auto it = m_entries.constFind(path);
+    if (it == m_entries.constEnd()) {
+        return nullptr;
+    }
+
+    if (!isFresh(path, *it)) {
+        remove(path); // Файл змінився після читання
+        return nullptr;
+    }
+
+    std::shared_ptr<const ImageCompression::RawImageData> image = it->image;
+    m_order.removeOne(path);
+    m_order.append(path);
+    return image;
+}
+
+void PrefetchCache::insert(const QString& path, const QDateTime& modified, qint64 fileSize, ImageCompression::RawImageData image) {
+    const qint64 imageBytes = static_cast<qint64>(image.data.size());
+    if (imageBytes > m_maxBytes) {
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+
+    remove(path);
+    m_entries.insert(path, Entry{std::make_shared<const ImageCompression::RawImageData>(std::move(image)), modified, fileSize});
+    m_order.append(path);
+    m_bytes += imageBytes;
+
+    while (m_bytes > m_maxBytes) {
+        remove(m_order.first());
+    }
+}
+
+bool PrefetchCache::contains(const QString& path) {
+    QMutexLocker locker(&m_mutex);
+
+    auto it = m_entries.constFind(path);
+    if (it == m_entries.constEnd()) {
+        return false;
+    }
+
+    if (!isFresh(path, *it)) {
+        remove(path); // Файл змінився після читання
+        return false;
+    }
+    return true;
+}
+
+bool PrefetchCache::isFresh(const QString& path, const Entry& entry) const {
+    QFileInfo fileInfo(path);
+    return fileInfo.lastModified() == entry.modified && fileInfo.size() == entry.fileSize;
+}
+
+void PrefetchCache::remove(const QString& path) {
+    auto it = m_entries.find(path);
+    if (it == m_entries.end()) {
+        return;
+    }
+    m_bytes -= static_cast<qint64>(it->image->data.size());
+    m_entries.erase(it);
+    m_order.removeOne(path);
+}
+
+// Читає та розкодовує файл у кеш, якщо вибір з моменту постановки в чергу не змінився
+static void prefetchFile(const QString& path, const QString& extension, const std::shared_ptr<PrefetchCache>& cache,
+                         const std::shared_ptr<std::atomic<int>>& generation, int expectedGeneration) {
+    if (*generation != expectedGeneration || cache->contains(path)) {
+        return;
+    }
+
+    try {
+        // Метадані знімаються до читання: якщо файл зміниться під час читання,
+        // запис у кеші не збігатиметься з новими метаданими і буде відкинутий
+        QFileInfo fileInfo(path);
+        const QDateTime modified = fileInfo.lastModified();
+        const qint64 fileSize = fileInfo.size();
+        ImageCompression::RawImageData img;
+
+        if (extension == "bmp") {
+            if (!ImageCompression::loadBmp(path, img)) return;
+        } else {
+            QFile inFile(path);
+            if (!inFile.open(QIODevice::ReadOnly)) return;
+            QByteArray data = inFile.readAll();
+
+            if (*generation != expectedGeneration) return; // Користувач уже перейшов далі
+            img = ImageCompression::decompress(std::vector<uint8_t>(data.begin(), data.end()));
+        }
+
+        cache->insert(path, modified, fileSize, std::move(img));
+    } catch (...) {
+        // Помилку буде показано при звичайній обробці файлу
+    }
+}
+
 FileModel::FileModel(QObject* parent)
     : QAbstractListModel(parent)
     , m_directory(QDir::currentPath())
+    , m_prefetchCache(std::make_shared<PrefetchCache>(kPrefetchCacheBytes))
+    , m_prefetchGeneration(std::make_shared<std::atomic<int>>(0))
 {
+    m_prefetchPool.setMaxThreadCount(1);
+    m_prefetchPool.setThreadPriority(QThread::IdlePriority);
+
     loadFiles();
 }
 
+FileModel::~FileModel() {
+    m_prefetchPool.clear();
+    m_prefetchPool.waitForDone();
+}
+
 int FileModel::rowCount(const QModelIndex& parent) const {
     Q_UNUSED(parent)
     return m_files.size();
@@ -66,6 +184,8 @@ void FileModel::setDirectory(const QString& path) {
 }
 
 void FileModel::loadFiles() {
+    cancelPrefetch(); // Задачі для старого списку файлів більше не потрібні
+
     beginResetModel();
     m_files.clear();
 
@@ -114,7 +234,7 @@ void FileModel::processFile(int index) {
     QString status = (item.extension == "bmp") ? "Кодується" : "Розкодовується";
     setFileProcessing(item.path, true, status);
 
-    FileProcessor* processor = new FileProcessor(item.path, this);
+    FileProcessor* processor = new FileProcessor(item.path, m_prefetchCache, this);
     connect(processor, &FileProcessor::finished, this, &FileModel::onFileProcessed);
     connect(processor, &FileProcessor::finished, processor, &FileProcessor::deleteLater);
     processor->start();
@@ -124,6 +244,46 @@ void FileModel::refreshDirectory() {
     loadFiles();
 }
 
+void FileModel::cancelPrefetch() {
+    // Задачі в черзі видаляються, а запущені перевіряють покоління перед розкодуванням
+    m_prefetchPool.clear();
+    ++*m_prefetchGeneration;
+}
+
+void FileModel::prefetchAround(int index) {
+    if (index < 0 || index >= m_files.size()) {
+        return;
+    }
+
+    cancelPrefetch();
+    const int generation = *m_prefetchGeneration;
+
+    // Вибраний файл, далі сусіди по черзі: +1, -1, +2, -2, ...
+    QList<int> order{index};
+    for (int distance = 1; distance <= kPrefetchDistance; ++distance) {
+        order << index + distance << index - distance;
+    }
+
+    int priority = static_cast<int>(order.size());
+    for (int i : order) {
+        --priority;
+        if (i < 0 || i >= m_files.size()) continue;
+
+        const FileItem& item = m_files[i];
+        if (item.extension != "bmp" && item.extension != "barch") continue;
+        if (item.isProcessing) continue; // FileProcessor вже читає цей файл
+        if (m_prefetchCache->contains(item.path)) continue;
+
+        QString path = item.path;
+        QString extension = item.extension;
+        std::shared_ptr<PrefetchCache> cache = m_prefetchCache;
+        std::shared_ptr<std::atomic<int>> generationCounter = m_prefetchGeneration;
+        m_prefetchPool.start([=]() {
+            prefetchFile(path, extension, cache, generationCounter, generation);
+        }, priority);
+    }
+}
+
 void FileModel::onFileProcessed(const QString& filePath, bool success, const QString& message) {
     setFileProcessing(filePath, false);
 
@@ -151,8 +311,8 @@ void FileModel::setFileProcessing(const QString& filePath, bool processing, cons
 }
 
 // FileProcessor implementation
-FileProcessor::FileProcessor(const QString& filePath, QObject* parent)
-    : QThread(parent), m_filePath(filePath)
+FileProcessor::FileProcessor(const QString& filePath, std::shared_ptr<PrefetchCache> cache, QObject* parent)
+    : QThread(parent), m_filePath(filePath), m_cache(std::move(cache))
 {
 }
 
@@ -180,14 +340,15 @@ void FileProcessor::run() {
 
 bool FileProcessor::processBmpFile(const QString& inputPath, const QString& outputPath) {
     try {
-        // Завантажуємо BMP файл
+        // Беремо завантажений заздалегідь BMP з кешу або завантажуємо файл
+        std::shared_ptr<const ImageCompression::RawImageData> cached = m_cache->find(inputPath);
         ImageCompression::RawImageData img;
-        if (!ImageCompression::loadBmp(inputPath, img)) {
+        if (!cached && !ImageCompression::loadBmp(inputPath, img)) {
             return false;
         }
 
         // Кодуємо зображення
-        std::vector<uint8_t> result = ImageCompression::compress(img);
+        std::vector<uint8_t> result = ImageCompression::compress(cached ? *cached : img);
 
         // Зберігаємо у файл
         QFile outFile(outputPath);
@@ -204,6 +365,12 @@ bool FileProcessor::processBmpFile(const QString& inputPath, const QString& outp
 
 bool FileProcessor::processBarchFile(const QString& inputPath, const QString& outputPath) {
     try {
+        // Беремо розкодоване заздалегідь зображення з кешу
+        if (std::shared_ptr<const ImageCompression::RawImageData> cached = m_cache->find(inputPath)) {
+            ImageCompression::saveBmp(outputPath, *cached);
+            return true;
+        }
+
         // Завантажуємо .barch файл
         QFile inFile(inputPath);
         if (!inFile.open(QIODevice::ReadOnly)) return false;
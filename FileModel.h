@@ -8,6 +8,12 @@
 #include <QDir>
 #include <QFileInfo>
 #include <QTimer>
+#include <QThreadPool>
+#include <QHash>
+#include <QDateTime>
+#include <atomic>
+#include <memory>
+#include "ImageCompression.h"
 
 struct FileItem {
     QString name;
@@ -20,6 +26,35 @@ struct FileItem {
     FileItem() : size(0), isProcessing(false) {}
 };
 
+// Кеш завантажених .bmp та розкодованих .barch зображень з обмеженням пам'яті.
+// Найдавніше використані записи витісняються першими.
+class PrefetchCache {
+public:
+    explicit PrefetchCache(qint64 maxBytes);
+
+    // Повертає зображення, якщо файл не змінився після читання, інакше nullptr
+    std::shared_ptr<const ImageCompression::RawImageData> find(const QString& path);
+    void insert(const QString& path, const QDateTime& modified, qint64 fileSize, ImageCompression::RawImageData image);
+    // Чи є актуальний запис для файлу; застарілий запис видаляється
+    bool contains(const QString& path);
+
+private:
+    struct Entry {
+        std::shared_ptr<const ImageCompression::RawImageData> image;
+        QDateTime modified;
+        qint64 fileSize;
+    };
+
+    bool isFresh(const QString& path, const Entry& entry) const;
+    void remove(const QString& path);
+
+    QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+    QStringList m_order;    // Від найдавніше до найостанніше використаного
+    qint64 m_bytes;
+    qint64 m_maxBytes;
+};
+
 class FileModel : public QAbstractListModel {
     Q_OBJECT
     Q_PROPERTY(QString directory READ directory WRITE setDirectory NOTIFY directoryChanged)
@@ -35,6 +70,7 @@ public:
     };
 
     explicit FileModel(QObject* parent = nullptr);
+    ~FileModel() override;
 
     int rowCount(const QModelIndex& parent = QModelIndex()) const override;
     QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
@@ -45,6 +81,7 @@ public:
 
     Q_INVOKABLE void processFile(int index);
     Q_INVOKABLE void refreshDirectory();
+    Q_INVOKABLE void prefetchAround(int index);
 
 signals:
     void directoryChanged();
@@ -55,18 +92,23 @@ private slots:
 
 private:
     void loadFiles();
+    void cancelPrefetch();
     void setFileProcessing(const QString& filePath, bool processing, const QString& status = "");
 
     QString m_directory;
     QList<FileItem> m_files;
     QMutex m_mutex;
+
+    std::shared_ptr<PrefetchCache> m_prefetchCache;
+    std::shared_ptr<std::atomic<int>> m_prefetchGeneration;   // Змінюється при кожному новому виборі
+    QThreadPool m_prefetchPool;
 };
 
 class FileProcessor : public QThread {
     Q_OBJECT
 
 public:
-    FileProcessor(const QString& filePath, QObject* parent = nullptr);
+    FileProcessor(const QString& filePath, std::shared_ptr<PrefetchCache> cache, QObject* parent = nullptr);
 
 protected:
     void run() override;
@@ -76,6 +118,7 @@ signals:
 
 private:
     QString m_filePath;
+    std::shared_ptr<PrefetchCache> m_cache;
 
     bool processBmpFile(const QString& inputPath, const QString& outputPath);
     bool processBarchFile(const QString& inputPath, const QString& outputPath);
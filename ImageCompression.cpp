@@ -2,6 +2,8 @@
 #include <stdexcept>
 #include <QFile>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
 
 namespace ImageCompression {
 
@@ -24,8 +26,22 @@ public:
     }
 
     void writeByte(unsigned char byte) {    // Записує байт у потік (8 біт)
-        for (int i = 7; i >= 0; --i) {
-            writeBit((byte >> i) & 1);
+        writeBits(byte, 8);
+    }
+
+    void writeBits(uint32_t value, int count) {    // Записує count молодших біт value, старшим бітом уперед
+        while (count > 0) {
+            if (m_bitPos == 8) {
+                m_buffer.push_back(0);
+                m_bytePos++;
+                m_bitPos = 0;
+            }
+            int free = 8 - m_bitPos;
+            int n = std::min(free, count);
+            uint8_t chunk = (value >> (count - n)) & ((1u << n) - 1);
+            m_buffer[m_bytePos] |= chunk << (free - n);
+            m_bitPos += n;
+            count -= n;
         }
     }
 
@@ -43,13 +59,43 @@ public:
     }
 
     unsigned char readByte() {    // Зчитує байт з потоку (8 біт)
-        uint8_t value = 0;
-        for (int i = 0; i < 8; ++i) {
-            value = (value << 1) | readBit();
+        return static_cast<unsigned char>(readBits(8));
+    }
+
+    uint32_t readBits(int count) {    // Зчитує count біт з потоку, старшим бітом уперед
+        uint32_t value = 0;
+        while (count > 0) {
+            if (m_bytePos >= m_buffer.size()) {
+                throw std::out_of_range("Attempted to read past end of bitstream.");
+            }
+            int avail = 8 - m_bitPos;
+            int n = std::min(avail, count);
+            uint8_t chunk = (m_buffer[m_bytePos] >> (avail - n)) & ((1u << n) - 1);
+            value = (value << n) | chunk;
+            m_bitPos += n;
+            count -= n;
+            if (m_bitPos == 8) {
+                m_bitPos = 0;
+                m_bytePos++;
+            }
         }
         return value;
     }
 
+    void writeBytes(const uint8_t* bytes, size_t bitCount) {    // Дописує перші bitCount біт з bytes
+        for (size_t i = 0; i < bitCount / 8; ++i) {
+            writeBits(bytes[i], 8);
+        }
+        const int tailBits = bitCount % 8;
+        if (tailBits) {
+            writeBits(bytes[bitCount / 8] >> (8 - tailBits), tailBits);
+        }
+    }
+
+    size_t bitSize() const {    // Кількість записаних біт
+        return m_bytePos * 8 + m_bitPos;
+    }
+
     const std::vector<uint8_t>& data() const {    // Отримує внутрішній буфер
         return m_buffer;
     }
@@ -60,6 +106,11 @@ public:
         m_bitPos = 0;
     }
 
+    void seekByte(size_t bytePos) {    // Переходить до початку байта bytePos
+        m_bytePos = bytePos;
+        m_bitPos = 0;
+    }
+
 private:
     std::vector<uint8_t> m_buffer;
     int m_bitPos;       // Поточна позиція біта в поточному байті (0-7)
@@ -251,116 +302,637 @@ bool saveBmp(const QString& path, const RawImageData& image) {
     return true;
 }
 
-// === === Функції стискання та розтискання === ===
+// === === Заголовок та квантування === ===
 
-std::vector<uint8_t> compress(const RawImageData &image) {
-    std::vector<uint8_t> result;
+// 'B' 'A' + ширина/висота + маска рядків + дані — початковий формат, 8 біт на піксель;
+//         ним записується Gray8, якщо жодна смуга не збережена як є
+// 'B' 'E' + ширина/висота + байт режиму + висота смуги (2 байти) + маска збережених смуг
+//         + зміщення смуг (по 4 байти, little-endian) + маска рядків + дані смуг
+// Дані кожної смуги починаються з межі байта: або кодовані рядки, або рівні рядків як є.
+static const uint8_t kSignatureLegacy = 'A';
+static const uint8_t kSignatureExtended = 'E';
+static const int kBandRows = 64;
+
+struct Header {
+    int width = 0;
+    int height = 0;
+    EncodingMode mode = EncodingMode::Gray8;
+    bool legacy = false;
+    int bandRows = 0;
+    int bandCount = 0;
+    size_t bandMaskPos = 0;     // Маска збережених смуг (1 біт на смугу)
+    size_t bandOffsetsPos = 0;  // Зміщення смуг відносно payloadPos
+    size_t rowMaskPos = 0;      // Маска порожніх рядків (1 біт на рядок)
+    size_t payloadPos = 0;      // Початок даних смуг
+};
 
-    // Заголовок: 'B' 'A'
+static int bitsPerPixel(EncodingMode mode) {
+    switch (mode) {
+    case EncodingMode::Gray8:
+        return 8;
+    case EncodingMode::Gray4:
+        return 4;
+    case EncodingMode::Bilevel:
+    case EncodingMode::BilevelDithered:
+        return 1;
+    }
+    throw std::runtime_error("Unknown encoding mode");
+}
+
+static void writeUint32(uint8_t* dst, uint32_t value) {
+    for (int i = 0; i < 4; ++i)
+        dst[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static uint32_t readUint32(const uint8_t* src) {
+    return src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<uint32_t>(src[3]) << 24);
+}
+
+// Обчислює розташування частин файлу за розмірами та висотою смуги
+static void layoutHeader(Header& header) {
+    const size_t rowMaskSize = (header.height + 7) / 8;
+    if (header.legacy) {
+        header.bandRows = std::max(header.height, 1);
+        header.bandCount = header.height > 0 ? 1 : 0;
+        header.rowMaskPos = 10;
+        header.payloadPos = header.rowMaskPos + rowMaskSize;
+        return;
+    }
+    header.bandCount = (header.height + header.bandRows - 1) / header.bandRows;
+    header.bandMaskPos = 13;
+    header.bandOffsetsPos = header.bandMaskPos + (header.bandCount + 7) / 8;
+    header.rowMaskPos = header.bandOffsetsPos + 4 * static_cast<size_t>(header.bandCount);
+    header.payloadPos = header.rowMaskPos + rowMaskSize;
+}
+
+static void writeHeader(std::vector<uint8_t>& result, const Header& header) {
     result.push_back('B');
-    result.push_back('A');
+    result.push_back(header.legacy ? kSignatureLegacy : kSignatureExtended);
 
     // Ширина та висота (по 4 байти кожна, little-endian)
     for (int i = 0; i < 4; ++i) {
-        result.push_back((image.width >> (8 * i)) & 0xFF);
-        result.push_back((image.height >> (8 * i)) & 0xFF);
+        result.push_back((header.width >> (8 * i)) & 0xFF);
+        result.push_back((header.height >> (8 * i)) & 0xFF);
     }
 
-    const int rowCount = image.height;
-    const int rowSize = image.width;
+    if (!header.legacy) {
+        result.push_back(static_cast<uint8_t>(header.mode));
+        result.push_back(header.bandRows & 0xFF);
+        result.push_back((header.bandRows >> 8) & 0xFF);
+    }
 
-    // Маска рядка
-    const int rowMaskSize = (rowCount + 7) / 8; // 1 біт на рядок
-    std::vector<uint8_t> rowMask(rowMaskSize, 0);
+    // Маска смуг, зміщення та маска рядків заповнюються під час кодування
+    result.resize(header.payloadPos, 0);
+}
 
-    // Поток кодованих даних
-    BitStream payloadBitStream;
+static Header readHeader(const std::vector<uint8_t>& compressedData) {
+    if (compressedData.size() < 10 || compressedData[0] != 'B')
+        throw std::runtime_error("Invalid format");
 
-    for (int j = 0; j < rowCount; ++j) {
-        bool isEmpty = true;
-        for (int i = 0; i < rowSize; ++i) {
-            if (image.data[j * rowSize + i] != 0xFF) {
-                isEmpty = false;
-                break;
+    Header header;
+    for (int i = 0; i < 4; ++i) {
+        header.width |= compressedData[2 + i * 2] << (8 * i);
+        header.height |= compressedData[3 + i * 2] << (8 * i);
+    }
+    if (header.width < 0 || header.height < 0)
+        throw std::runtime_error("Invalid format");
+
+    if (compressedData[1] == kSignatureLegacy) {
+        header.legacy = true;
+    } else if (compressedData[1] == kSignatureExtended && compressedData.size() >= 13) {
+        if (compressedData[10] > static_cast<uint8_t>(EncodingMode::BilevelDithered))
+            throw std::runtime_error("Unknown encoding mode");
+        header.mode = static_cast<EncodingMode>(compressedData[10]);
+        header.bandRows = compressedData[11] | (compressedData[12] << 8);
+        if (header.bandRows == 0)
+            throw std::runtime_error("Invalid format");
+    } else {
+        throw std::runtime_error("Invalid format");
+    }
+
+    layoutHeader(header);
+    if (compressedData.size() < header.payloadPos)
+        throw std::runtime_error("Invalid format");
+    return header;
+}
+
+static bool isBandStored(const std::vector<uint8_t>& compressedData, const Header& header, int band) {
+    if (header.legacy) return false;
+    return compressedData[header.bandMaskPos + band / 8] & (1 << (band % 8));
+}
+
+static size_t bandBegin(const std::vector<uint8_t>& compressedData, const Header& header, int band) {
+    if (band == header.bandCount) return compressedData.size();
+    if (header.legacy) return header.payloadPos;
+    return header.payloadPos + readUint32(compressedData.data() + header.bandOffsetsPos + 4 * band);
+}
+
+// Поріг упорядкованого дизерингу (матриця Байєра 4x4, масштабована до 0..255)
+static const uint8_t kBayer4x4[4][4] = {
+    {   8, 136,  40, 168 },
+    { 200,  72, 232, 104 },
+    {  56, 184,  24, 152 },
+    { 248, 120, 216,  88 }
+};
+
+// Кількість пікселів, що квантуються за один блок. Внутрішній цикл блоку має сталу
+// кількість ітерацій і не потребує хвоста, тому GCC векторизує його вже на -O2.
+static const int kQuantizeBlock = 16;
+
+static inline uint8_t quantizeGray4(uint8_t v) {
+    return static_cast<uint8_t>((v * 15 + 135) >> 8);    // round(v * 15 / 255)
+}
+
+// Переводить рядок пікселів у рівні режиму кодування (0 — чорний, максимум — білий).
+// Рядок обробляється блоками по kQuantizeBlock пікселів, залишок — поелементно.
+static void quantizeRow(const uint8_t* __restrict src, uint8_t* __restrict dst, int width, int y, EncodingMode mode) {
+    if (width <= 0) return;
+
+    int i = 0;
+    switch (mode) {
+    case EncodingMode::Gray8:
+        std::memcpy(dst, src, width);
+        break;
+    case EncodingMode::Gray4:
+        for (; i + kQuantizeBlock <= width; i += kQuantizeBlock)
+            for (int k = 0; k < kQuantizeBlock; ++k)
+                dst[i + k] = quantizeGray4(src[i + k]);
+        for (; i < width; ++i)
+            dst[i] = quantizeGray4(src[i]);
+        break;
+    case EncodingMode::Bilevel:
+        for (; i + kQuantizeBlock <= width; i += kQuantizeBlock)
+            for (int k = 0; k < kQuantizeBlock; ++k)
+                dst[i + k] = src[i + k] >> 7;
+        for (; i < width; ++i)
+            dst[i] = src[i] >> 7;
+        break;
+    case EncodingMode::BilevelDithered: {
+        // Рядок порогів на весь блок; блоки починаються з кратних 4 позицій
+        uint8_t threshold[kQuantizeBlock];
+        for (int k = 0; k < kQuantizeBlock; ++k)
+            threshold[k] = kBayer4x4[y & 3][k & 3];
+
+        for (; i + kQuantizeBlock <= width; i += kQuantizeBlock)
+            for (int k = 0; k < kQuantizeBlock; ++k)
+                dst[i + k] = src[i + k] >= threshold[k];
+        for (; i < width; ++i)
+            dst[i] = src[i] >= threshold[i & 3];
+        break;
+    }
+    }
+}
+
+// Пакує рядок рівнів по bpp біт, старшим бітом уперед. dst має бути обнулений.
+static void packRow(const uint8_t* levels, uint8_t* dst, int width, int bpp) {
+    if (width <= 0) return;
+    if (bpp == 8) {
+        std::memcpy(dst, levels, width);
+        return;
+    }
+    for (int i = 0; i < width; ++i) {
+        const int bitPos = i * bpp;
+        dst[bitPos / 8] |= levels[i] << (8 - bpp - bitPos % 8);
+    }
+}
+
+// === === Запис у кадровий буфер === ===
+
+// Заповнює біти [begin, end) рядка байтом-шаблоном
+static void fillBits(uint8_t* row, int begin, int end, uint8_t pattern) {
+    if (begin >= end) return;
+
+    const int firstByte = begin / 8;
+    const int lastByte = (end - 1) / 8;
+    const uint8_t headMask = 0xFF >> (begin % 8);
+    const uint8_t tailMask = 0xFF << (7 - (end - 1) % 8);
+
+    if (firstByte == lastByte) {
+        const uint8_t mask = headMask & tailMask;
+        row[firstByte] = (row[firstByte] & ~mask) | (pattern & mask);
+        return;
+    }
+    row[firstByte] = (row[firstByte] & ~headMask) | (pattern & headMask);
+    std::memset(row + firstByte + 1, pattern, lastByte - firstByte - 1);
+    row[lastByte] = (row[lastByte] & ~tailMask) | (pattern & tailMask);
+}
+
+// Записує пікселі зображення у кадровий буфер з упаковкою та поворотом
+class FramebufferWriter {
+public:
+    FramebufferWriter(const Framebuffer& target, Rotation rotation, int imageWidth, int imageHeight)
+        : m_target(target)
+        , m_rotation(rotation)
+        , m_imageWidth(imageWidth)
+        , m_imageHeight(imageHeight)
+        , m_bpp(static_cast<int>(target.format))
+    {
+        const bool swapped = rotation != Rotation::None;
+        const int width = swapped ? imageHeight : imageWidth;
+        const int height = swapped ? imageWidth : imageHeight;
+        const bool isEmpty = width == 0 || height == 0;
+        if (!isEmpty && (target.data == nullptr || target.width < width || target.height < height
+                         || target.stride < (width * m_bpp + 7) / 8)) {
+            throw std::runtime_error("Framebuffer is too small");
+        }
+    }
+
+    void fill(int x, int y, int count, uint8_t gray) {    // Заповнює count пікселів рядка y, починаючи з x
+        const uint8_t level = gray >> (8 - m_bpp);
+        if (m_rotation == Rotation::None) {
+            // Рівень, повторений на весь байт: 0x00 для чорного, 0xFF для білого
+            const uint8_t pattern = static_cast<uint8_t>(level * (255 / ((1 << m_bpp) - 1)));
+            fillBits(m_target.data + static_cast<size_t>(y) * m_target.stride, x * m_bpp, (x + count) * m_bpp, pattern);
+            return;
+        }
+        for (int k = 0; k < count; ++k)
+            putLevel(x + k, y, level);
+    }
+
+    void put(int x, int y, uint8_t gray) {    // Записує один піксель
+        putLevel(x, y, gray >> (8 - m_bpp));
+    }
+
+    void copyRow(int y, const uint8_t* packed, int srcBpp, int scale) {    // Записує рядок рівнів, упакованих по srcBpp біт
+        if (m_rotation == Rotation::None && srcBpp == m_bpp) {
+            uint8_t* row = m_target.data + static_cast<size_t>(y) * m_target.stride;
+            const int fullBytes = m_imageWidth * m_bpp / 8;
+            std::memcpy(row, packed, fullBytes);
+            const int tailBits = m_imageWidth * m_bpp % 8;
+            if (tailBits) {
+                const uint8_t mask = 0xFF << (8 - tailBits);
+                row[fullBytes] = (row[fullBytes] & ~mask) | (packed[fullBytes] & mask);
             }
+            return;
+        }
+        const int levelMask = (1 << srcBpp) - 1;
+        for (int x = 0; x < m_imageWidth; ++x) {
+            const int bitPos = x * srcBpp;
+            const int level = (packed[bitPos / 8] >> (8 - srcBpp - bitPos % 8)) & levelMask;
+            put(x, y, static_cast<uint8_t>(level * scale));
+        }
+    }
+
+private:
+    void putLevel(int x, int y, uint8_t level) {
+        int fx = x;
+        int fy = y;
+        if (m_rotation == Rotation::Rotate90) {
+            fx = m_imageHeight - 1 - y;
+            fy = x;
+        } else if (m_rotation == Rotation::Rotate270) {
+            fx = y;
+            fy = m_imageWidth - 1 - x;
         }
+
+        uint8_t* row = m_target.data + static_cast<size_t>(fy) * m_target.stride;
+        if (m_bpp == 8) {
+            row[fx] = level;
+            return;
+        }
+        const int bitPos = fx * m_bpp;
+        const int shift = 8 - m_bpp - bitPos % 8;
+        const uint8_t mask = static_cast<uint8_t>(((1 << m_bpp) - 1) << shift);
+        row[bitPos / 8] = (row[bitPos / 8] & ~mask) | (level << shift);
+    }
+
+    Framebuffer m_target;
+    Rotation m_rotation;
+    int m_imageWidth;
+    int m_imageHeight;
+    int m_bpp;
+};
+
+// === === Функції стискання та розтискання === ===
+
+// Кожен kSampleStep-й непорожній рядок смуги використовується для оцінки стиснення
+static const int kSampleStep = 8;
+
+enum class GroupCode {
+    White,      // 0b0
+    Black,      // 0b10
+    Literal     // 0b11 + рівні пікселів
+};
+
+// Класифікує фрагмент з count (до 4) пікселів; неповний фрагмент доповнюється білим
+static GroupCode classifyGroup(const uint8_t* levels, int count, uint8_t white) {
+    bool isWhite = true;
+    bool isBlack = count == 4;
+    for (int k = 0; k < count; ++k) {
+        isWhite = isWhite && levels[k] == white;
+        isBlack = isBlack && levels[k] == 0x00;
+    }
+    if (isWhite) return GroupCode::White;
+    if (isBlack) return GroupCode::Black;
+    return GroupCode::Literal;
+}
+
+// Кодує рядок рівнів фрагментами по 4 пікселі
+static void encodeRow(BitStream& stream, const uint8_t* levels, int width, int bpp) {
+    const uint8_t white = static_cast<uint8_t>((1 << bpp) - 1);
+    for (int i = 0; i < width; i += 4) {
+        const int count = std::min(4, width - i);
+        switch (classifyGroup(levels + i, count, white)) {
+        case GroupCode::White:
+            stream.writeBit(0);
+            break;
+        case GroupCode::Black:
+            stream.writeBits(0b10, 2);
+            break;
+        case GroupCode::Literal:
+            stream.writeBits(0b11, 2);
+            for (int k = 0; k < count; ++k)
+                stream.writeBits(levels[i + k], bpp);
+            break;
+        }
+    }
+}
+
+// Розмір кодованого рядка в бітах, без запису в потік
+static size_t codedRowBits(const uint8_t* levels, int width, int bpp) {
+    const uint8_t white = static_cast<uint8_t>((1 << bpp) - 1);
+    size_t bits = 0;
+    for (int i = 0; i < width; i += 4) {
+        const int count = std::min(4, width - i);
+        switch (classifyGroup(levels + i, count, white)) {
+        case GroupCode::White:
+            bits += 1;
+            break;
+        case GroupCode::Black:
+            bits += 2;
+            break;
+        case GroupCode::Literal:
+            bits += 2 + count * bpp;
+            break;
+        }
+    }
+    return bits;
+}
+
+// Кодує рядки [firstRow, firstRow + rowCount) як одну смугу і дописує її дані в out.
+// Оновлює біти порожніх рядків у rowMask. Повертає true, якщо смуга збережена як є:
+// коли за вибіркою рядків кодування не дає виграшу або кодовані дані вийшли більшими.
+// У codedBits, якщо задано, записується точна кількість біт кодованої смуги.
+static bool encodeBand(const RawImageData& image, EncodingMode mode, int firstRow, int rowCount,
+                       std::vector<uint8_t>& rowMask, std::vector<uint8_t>& out, size_t* codedBits = nullptr) {
+    if (codedBits) *codedBits = 0;
+
+    const int width = image.width;
+    const int bpp = bitsPerPixel(mode);
+    const uint8_t white = static_cast<uint8_t>((1 << bpp) - 1);
+    const size_t rowBytes = (static_cast<size_t>(width) * bpp + 7) / 8;
+
+    // Рядки смуги, переведені у рівні режиму кодування
+    std::vector<uint8_t> levels(static_cast<size_t>(rowCount) * width);
+    std::vector<int> rows; // Непорожні рядки смуги
+
+    for (int r = 0; r < rowCount; ++r) {
+        const int j = firstRow + r;
+        uint8_t* rowLevels = levels.data() + static_cast<size_t>(r) * width;
+        quantizeRow(image.data.data() + static_cast<size_t>(j) * width, rowLevels, width, j, mode);
+
+        const bool isEmpty = std::all_of(rowLevels, rowLevels + width, [white](uint8_t level) { return level == white; });
         if (isEmpty) {
             rowMask[j / 8] |= (1 << (j % 8));
-            continue;
+        } else {
+            rowMask[j / 8] &= ~(1 << (j % 8));
+            rows.push_back(r);
         }
+    }
+    if (rows.empty()) return false;
+
+    // Вибірка: кодувати варто, якщо оцінка менша за 7/8 розміру збережених рядків
+    size_t sampledBits = 0;
+    size_t sampledRows = 0;
+    for (size_t k = 0; k < rows.size(); k += kSampleStep) {
+        sampledBits += codedRowBits(levels.data() + static_cast<size_t>(rows[k]) * width, width, bpp);
+        sampledRows++;
+    }
 
-        // Обробка рядка фрагментами по 4 пікселі
-        for (int i = 0; i < rowSize; i += 4) {
-            int count = std::min(4, rowSize - i);
-            uint8_t group[4] = {0xFF, 0xFF, 0xFF, 0xFF};
-            for (int k = 0; k < count; ++k) {
-                group[k] = image.data[j * rowSize + i + k];
-            }
+    const size_t storedBytes = rows.size() * rowBytes;
+    if (sampledBits < sampledRows * rowBytes * 7) {
+        BitStream payloadBitStream;
+        for (int r : rows)
+            encodeRow(payloadBitStream, levels.data() + static_cast<size_t>(r) * width, width, bpp);
 
-            if (group[0] == 0xFF && group[1] == 0xFF && group[2] == 0xFF && group[3] == 0xFF) {
-                payloadBitStream.writeBit(0); // 0b0
-            } else if (group[0] == 0x00 && group[1] == 0x00 && group[2] == 0x00 && group[3] == 0x00) {
-                payloadBitStream.writeBit(1); // 0b10
-                payloadBitStream.writeBit(0);
-            } else {
-                payloadBitStream.writeBit(1); // 0b11
-                payloadBitStream.writeBit(1);
-                for (int k = 0; k < count; ++k)
-                    payloadBitStream.writeByte(group[k]);
-            }
+        if (payloadBitStream.data().size() < storedBytes) {
+            out.insert(out.end(), payloadBitStream.data().begin(), payloadBitStream.data().end());
+            if (codedBits) *codedBits = payloadBitStream.bitSize();
+            return false;
         }
     }
 
-    result.insert(result.end(), rowMask.begin(), rowMask.end());
-    result.insert(result.end(), payloadBitStream.data().begin(), payloadBitStream.data().end());
+    size_t pos = out.size();
+    out.resize(pos + storedBytes, 0);
+    for (int r : rows) {
+        packRow(levels.data() + static_cast<size_t>(r) * width, out.data() + pos, width, bpp);
+        pos += rowBytes;
+    }
+    return true;
+}
+
+std::vector<uint8_t> compress(const RawImageData &image, EncodingMode mode, bool allowLegacyLayout) {
+    Header header;
+    header.width = image.width;
+    header.height = image.height;
+    header.mode = mode;
+    header.bandRows = kBandRows;
+    layoutHeader(header);
+
+    std::vector<uint8_t> result;
+    writeHeader(result, header);
+
+    // Маска рядка
+    const int rowMaskSize = (image.height + 7) / 8; // 1 біт на рядок
+    std::vector<uint8_t> rowMask(rowMaskSize, 0);
+
+    std::vector<size_t> bandBits(header.bandCount, 0);
+    bool hasStoredBands = false;
+
+    for (int band = 0; band < header.bandCount; ++band) {
+        writeUint32(result.data() + header.bandOffsetsPos + 4 * band, static_cast<uint32_t>(result.size() - header.payloadPos));
+
+        const int firstRow = band * header.bandRows;
+        const int rowCount = std::min(header.bandRows, image.height - firstRow);
+        if (encodeBand(image, mode, firstRow, rowCount, rowMask, result, &bandBits[band])) {
+            result[header.bandMaskPos + band / 8] |= (1 << (band % 8));
+            hasStoredBands = true;
+        }
+    }
+
+    if (allowLegacyLayout && mode == EncodingMode::Gray8 && !hasStoredBands) {
+        // Без збережених смуг Gray8 записується у початковому форматі 'B' 'A', який читають
+        // і попередні версії: кодовані смуги зшиваються в один неперервний потік бітів
+        Header legacyHeader;
+        legacyHeader.width = image.width;
+        legacyHeader.height = image.height;
+        legacyHeader.legacy = true;
+        layoutHeader(legacyHeader);
+
+        std::vector<uint8_t> legacyResult;
+        writeHeader(legacyResult, legacyHeader);
+        std::copy(rowMask.begin(), rowMask.end(), legacyResult.begin() + legacyHeader.rowMaskPos);
+
+        BitStream payloadBitStream;
+        for (int band = 0; band < header.bandCount; ++band)
+            payloadBitStream.writeBytes(result.data() + bandBegin(result, header, band), bandBits[band]);
+
+        legacyResult.insert(legacyResult.end(), payloadBitStream.data().begin(), payloadBitStream.data().end());
+        return legacyResult;
+    }
+
+    std::copy(rowMask.begin(), rowMask.end(), result.begin() + header.rowMaskPos);
     return result;
 }
 
-RawImageData decompress(const std::vector<uint8_t> &compressedData) {
-    if (compressedData.size() < 10 || compressedData[0] != 'B' || compressedData[1] != 'A')
-        throw std::runtime_error("Invalid format");
+// Перекодовує смуги, позначені в dirtyBands. Спершу кодуються всі змінені смуги, потім файл
+// збирається за один прохід: незмінені смуги копіюються, зміщення та маски переписуються.
+static void recompressBands(std::vector<uint8_t>& compressedData, const Header& header, const RawImageData& image,
+                            const std::vector<bool>& dirtyBands) {
+    if (image.width != header.width || image.height != header.height)
+        throw std::runtime_error("Image size mismatch");
 
-    int width = 0;
-    int height = 0;
-    for (int i = 0; i < 4; ++i) {
-        width |= compressedData[2 + i * 2] << (8 * i);
-        height |= compressedData[3 + i * 2] << (8 * i);
+    if (std::none_of(dirtyBands.begin(), dirtyBands.end(), [](bool dirty) { return dirty; }))
+        return;
+
+    if (header.legacy) {
+        // Початковий формат не має зміщень смуг: один раз переводимо файл у формат зі смугами
+        compressedData = compress(image, header.mode, false);
+        return;
+    }
+
+    std::vector<uint8_t> rowMask(compressedData.begin() + header.rowMaskPos, compressedData.begin() + header.payloadPos);
+
+    // Нові дані змінених смуг, записані одна за одною
+    std::vector<uint8_t> bandData;
+    std::vector<size_t> bandDataBegin(header.bandCount + 1, 0);
+    std::vector<bool> bandStored(header.bandCount, false);
+
+    for (int band = 0; band < header.bandCount; ++band) {
+        bandDataBegin[band] = bandData.size();
+        if (!dirtyBands[band]) continue;
+
+        const int firstRow = band * header.bandRows;
+        const int rowCount = std::min(header.bandRows, image.height - firstRow);
+        bandStored[band] = encodeBand(image, header.mode, firstRow, rowCount, rowMask, bandData);
+    }
+    bandDataBegin[header.bandCount] = bandData.size();
+
+    std::vector<uint8_t> result(compressedData.begin(), compressedData.begin() + header.payloadPos);
+    result.reserve(compressedData.size() + bandData.size());
+
+    for (int band = 0; band < header.bandCount; ++band) {
+        const size_t begin = bandBegin(compressedData, header, band);
+        const size_t end = bandBegin(compressedData, header, band + 1);
+        if (begin > end || end > compressedData.size())
+            throw std::runtime_error("Invalid format");
+
+        writeUint32(result.data() + header.bandOffsetsPos + 4 * band, static_cast<uint32_t>(result.size() - header.payloadPos));
+        if (!dirtyBands[band]) {
+            result.insert(result.end(), compressedData.begin() + begin, compressedData.begin() + end);
+            continue;
+        }
+
+        result.insert(result.end(), bandData.begin() + bandDataBegin[band], bandData.begin() + bandDataBegin[band + 1]);
+        uint8_t& bandMaskByte = result[header.bandMaskPos + band / 8];
+        if (bandStored[band])
+            bandMaskByte |= (1 << (band % 8));
+        else
+            bandMaskByte &= ~(1 << (band % 8));
+    }
+
+    std::copy(rowMask.begin(), rowMask.end(), result.begin() + header.rowMaskPos);
+    compressedData.swap(result);
+}
+
+void recompressRows(std::vector<uint8_t> &compressedData, const RawImageData &image, const std::vector<bool> &dirtyRows) {
+    const Header header = readHeader(compressedData);
+
+    std::vector<bool> dirtyBands(header.bandCount, false);
+    const int rowCount = std::min(static_cast<int>(dirtyRows.size()), header.height);
+    for (int j = 0; j < rowCount; ++j) {
+        if (dirtyRows[j])
+            dirtyBands[j / header.bandRows] = true;
     }
+    recompressBands(compressedData, header, image, dirtyBands);
+}
 
-    const int rowSize = width;
-    const int rowMaskSize = (height + 7) / 8;
-    const uint8_t* rowMask = compressedData.data() + 10;
+void recompressRows(std::vector<uint8_t> &compressedData, const RawImageData &image, int firstRow, int rowCount) {
+    const Header header = readHeader(compressedData);
 
-    std::vector<uint8_t> imageData(width * height, 0xFF);
+    std::vector<bool> dirtyBands(header.bandCount, false);
+    const int first = std::max(firstRow, 0);
+    const int last = std::min(firstRow + rowCount, header.height); // не включно
+    for (int j = first; j < last; j += header.bandRows - j % header.bandRows)
+        dirtyBands[j / header.bandRows] = true;
+    recompressBands(compressedData, header, image, dirtyBands);
+}
+
+RawImageData decompress(const std::vector<uint8_t> &compressedData) {
+    const Header header = readHeader(compressedData);
+
+    std::vector<uint8_t> imageData(static_cast<size_t>(header.width) * header.height);
+    decompressTo(compressedData, Framebuffer{imageData.data(), header.width, header.height, header.width, PixelFormat::Gray8});
+
+    return RawImageData{header.width, header.height, std::move(imageData)};
+}
+
+void decompressTo(const std::vector<uint8_t> &compressedData, const Framebuffer &target, Rotation rotation) {
+    const Header header = readHeader(compressedData);
+    const int width = header.width;
+    const int height = header.height;
+    const uint8_t* rowMask = compressedData.data() + header.rowMaskPos;
+
+    // Рівень режиму кодування -> 8-бітний сірий (255 / максимальний рівень)
+    const int bpp = bitsPerPixel(header.mode);
+    const int scale = 255 / ((1 << bpp) - 1);
+    const size_t rowBytes = (static_cast<size_t>(width) * bpp + 7) / 8;
+
+    FramebufferWriter writer(target, rotation, width, height);
 
     BitStream dataBitStream;
     dataBitStream.setBuffer(compressedData);
-    for (int i = 0; i < 10 + rowMaskSize; ++i) {
-        dataBitStream.readByte(); // відступаемо до стисненних даних рядків
-    }
-    for (int j = 0; j < height; ++j) {
-        bool isEmpty = rowMask[j / 8] & (1 << (j % 8));
-        if (isEmpty) continue;
-
-        for (int i = 0; i < width;) {
-            if (dataBitStream.readBit() == 0) {         // Код 0: чотири білих пікселі
-                for (int k = 0; (k < 4) && (i + k < width); ++k)
-                    imageData[j * rowSize + i + k] = 0xFF;
-                i += 4;
-            } else if (dataBitStream.readBit() == 0) {  // Код 10: чотири чорних пікселі
-                for (int k = 0; (k < 4) && (i + k < width); ++k)
-                    imageData[j * rowSize + i + k] = 0x00;
-                i += 4;
-            } else {                                    // Код 11: чотири будь-які інші пікселі
-                for (int k = 0; (k < 4) && (i + k < width); ++k)
-                    imageData[j * rowSize + i + k] = dataBitStream.readByte();
-                i += 4;
+
+    for (int band = 0; band < header.bandCount; ++band) {
+        const size_t begin = bandBegin(compressedData, header, band);
+        const size_t end = bandBegin(compressedData, header, band + 1);
+        if (begin > end || end > compressedData.size())
+            throw std::runtime_error("Invalid format");
+
+        const int firstRow = band * header.bandRows;
+        const int lastRow = std::min(firstRow + header.bandRows, height);
+        const bool isStored = isBandStored(compressedData, header, band);
+        size_t storedPos = begin;
+        dataBitStream.seekByte(begin); // відступаемо до даних смуги
+
+        for (int j = firstRow; j < lastRow; ++j) {
+            bool isEmpty = rowMask[j / 8] & (1 << (j % 8));
+            if (isEmpty) {
+                writer.fill(0, j, width, 0xFF);
+                continue;
+            }
+
+            if (isStored) {                                 // Рядок збережено як є
+                if (storedPos + rowBytes > end)
+                    throw std::runtime_error("Invalid format");
+                writer.copyRow(j, compressedData.data() + storedPos, bpp, scale);
+                storedPos += rowBytes;
+                continue;
+            }
+
+            for (int i = 0; i < width; i += 4) {
+                const int count = std::min(4, width - i);
+                if (dataBitStream.readBit() == 0) {         // Код 0: чотири білих пікселі
+                    writer.fill(i, j, count, 0xFF);
+                } else if (dataBitStream.readBit() == 0) {  // Код 10: чотири чорних пікселі
+                    writer.fill(i, j, count, 0x00);
+                } else {                                    // Код 11: чотири будь-які інші пікселі
+                    for (int k = 0; k < count; ++k)
+                        writer.put(i + k, j, static_cast<uint8_t>(dataBitStream.readBits(bpp) * scale));
+                }
             }
         }
     }
-
-    return RawImageData{width, height, std::move(imageData)};
 }
 
 }
-
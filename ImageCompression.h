@@ -12,11 +12,54 @@ struct RawImageData {
     std::vector<uint8_t> data;
 };
 
+// Режим кодування літеральних груп (код 0b11). Записується в заголовок файлу.
+enum class EncodingMode : uint8_t {
+    Gray8 = 0,              // 256 рівнів сірого, 8 біт на піксель (початковий формат)
+    Gray4 = 1,              // 16 рівнів сірого, 4 біти на піксель
+    Bilevel = 2,            // чорно-біле, 1 біт на піксель (поріг 128)
+    BilevelDithered = 3     // чорно-біле, 1 біт на піксель з упорядкованим дизерингом
+};
+
+// Формат пікселів кадрового буфера (біт на піксель). Пікселі упаковані старшим бітом уперед,
+// рівень 0 — чорний, максимальний рівень — білий.
+enum class PixelFormat : uint8_t {
+    Gray8 = 8,
+    Gray4 = 4,
+    Gray2 = 2,
+    Mono1 = 1
+};
+
+// Поворот зображення за годинниковою стрілкою при виведенні в кадровий буфер
+enum class Rotation : uint8_t {
+    None,
+    Rotate90,
+    Rotate270
+};
+
+// Кадровий буфер, наданий викликаючою стороною. Розміри — після повороту.
+struct Framebuffer {
+    uint8_t* data;
+    int width;
+    int height;
+    int stride;             // Байт на рядок
+    PixelFormat format;
+};
+
 bool loadBmp(const QString& path, RawImageData& outImage);
 bool saveBmp(const QString& path, const RawImageData& image);
 
-std::vector<uint8_t> compress(const RawImageData &image);
+// Gray8 без збережених смуг записується у початковому форматі 'B' 'A', який читають попередні
+// версії. allowLegacyLayout = false завжди дає формат зі смугами 'B' 'E' для подальшого recompressRows.
+std::vector<uint8_t> compress(const RawImageData &image, EncodingMode mode = EncodingMode::Gray8, bool allowLegacyLayout = true);
+
+// Перекодовує лише смуги, що містять змінені рядки, і вставляє їх у compressedData.
+// image — оновлене зображення тих самих розмірів; dirtyRows[j] == true для зміненого рядка j.
+// Результат завжди у форматі зі смугами і збігається з compress(image, mode, false): файл у форматі
+// 'B' 'A' при першому редагуванні кодується повністю, наступні редагування — інкрементні.
+void recompressRows(std::vector<uint8_t> &compressedData, const RawImageData &image, const std::vector<bool> &dirtyRows);
+void recompressRows(std::vector<uint8_t> &compressedData, const RawImageData &image, int firstRow, int rowCount);
 RawImageData decompress(const std::vector<uint8_t> &compressedData);
+void decompressTo(const std::vector<uint8_t> &compressedData, const Framebuffer &target, Rotation rotation = Rotation::None);
 
 }
 
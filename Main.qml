@@ -56,6 +56,11 @@ ApplicationWindow {
                 model: fileModel
                 clip: true
 
+                // Попередньо читаємо файли навколо видимої середини списку після прокрутки
+                onMovementEnded: {
+                    fileModel.prefetchAround(indexAt(contentX + width / 2, contentY + height / 2))
+                }
+
                 delegate: Rectangle {
                     width: listView.width
                     height: 60
@@ -66,8 +71,13 @@ ApplicationWindow {
                     MouseArea {
                         id: mouseArea
                         anchors.fill: parent
+                        hoverEnabled: true
+                        onEntered: {
+                            fileModel.prefetchAround(index)
+                        }
                         onClicked: {
                             fileModel.processFile(index)
+                            fileModel.prefetchAround(index)
                         }
                     }
 